@@ -6,9 +6,17 @@
 #include <numeric>
 #include <pdh.h>
 #include <pdhmsg.h>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
 
 using namespace std;
 
+#define RUN_SIZE 4096
+#define TIER_FANOUT 4
+#define CHUNKED_SORT_MIN (4 * RUN_SIZE)
+
 struct Data
 {
 	int TID;
@@ -27,6 +35,328 @@ DWORD WINAPI SortThread(LPVOID param)
 	return 0;
 }
 
+typedef shared_ptr<const vector<int>> Run;
+typedef pair<const int*, const int*> RunSlice;
+
+// k-way слияние отсортированных срезов через кучу минимумов
+void MergeSlices(const vector<RunSlice>& slices, vector<int>& out)
+{
+	typedef pair<int, size_t> HeapItem;
+	priority_queue<HeapItem, vector<HeapItem>, greater<HeapItem>> heap;
+	vector<const int*> cursors(slices.size());
+
+	size_t total = 0;
+	for (size_t i = 0; i < slices.size(); i++)
+	{
+		cursors[i] = slices[i].first;
+		if (cursors[i] < slices[i].second)
+		{
+			total += slices[i].second - slices[i].first;
+			heap.push(HeapItem(*cursors[i], i));
+		}
+	}
+
+	out.reserve(out.size() + total);
+	while (!heap.empty())
+	{
+		size_t i = heap.top().second;
+		heap.pop();
+		out.push_back(*cursors[i]);
+		if (++cursors[i] < slices[i].second)
+			heap.push(HeapItem(*cursors[i], i));
+	}
+}
+
+// Делит values на count частей и запускает для каждой поток SortThread.
+// Если поток создать не удалось, часть сортируется сразу в вызывающем потоке
+void StartChunkedSort(const vector<int>& values, int count, vector<vector<int>>& partsArr, vector<Data>& data, vector<HANDLE>& threads)
+{
+	size_t partSize = values.size() / count;
+	partsArr.assign(count, vector<int>());
+	data.assign(count, Data());
+
+	for (int i = 0; i < count; i++)
+	{
+		if (i == count - 1) {
+			partsArr[i].assign(values.begin() + i * partSize, values.end());
+		}
+		else {
+			partsArr[i].assign(values.begin() + i * partSize, values.begin() + (i + 1) * partSize);
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		data[i].TID = i;
+		data[i].isComplate = false;
+		data[i].part = &partsArr[i];
+
+		HANDLE thread = CreateThread(NULL, 0, SortThread, &data[i], 0, NULL);
+		if (thread != NULL)
+			threads.push_back(thread);
+		else
+			SortThread(&data[i]);
+	}
+}
+
+// WaitForMultipleObjects принимает не больше MAXIMUM_WAIT_OBJECTS описателей,
+// поэтому потоки ожидаются группами
+void WaitForThreads(vector<HANDLE>& threads)
+{
+	for (size_t first = 0; first < threads.size(); first += MAXIMUM_WAIT_OBJECTS)
+	{
+		DWORD groupSize = (DWORD)min(threads.size() - first, (size_t)MAXIMUM_WAIT_OBJECTS);
+		if (WaitForMultipleObjects(groupSize, threads.data() + first, TRUE, INFINITE) == WAIT_FAILED)
+		{
+			for (size_t i = first; i < first + groupSize; i++)
+				WaitForSingleObject(threads[i], INFINITE);
+		}
+	}
+
+	for (HANDLE thread : threads)
+		CloseHandle(thread);
+	threads.clear();
+}
+
+// Сортировка по частям, как в основном режиме, с k-way слиянием частей
+void ChunkedSort(vector<int>& values, int count)
+{
+	vector<vector<int>> partsArr;
+	vector<Data> data;
+	vector<HANDLE> threads;
+	StartChunkedSort(values, count, partsArr, data, threads);
+	WaitForThreads(threads);
+
+	vector<RunSlice> slices;
+	for (const vector<int>& part : partsArr)
+		slices.push_back(RunSlice(part.data(), part.data() + part.size()));
+	values.clear();
+	MergeSlices(slices, values);
+}
+
+// Инкрементальный отсортированный контейнер: вставки копятся в буфере,
+// заполненный буфер сортируется в прогон уровня 0. Когда на уровне набирается
+// TIER_FANOUT прогонов, фоновый поток сливает их в один прогон следующего уровня.
+// Запросы берут снимок прогонов и не ждут слияний.
+class SortedRuns
+{
+private:
+	SRWLOCK lock;
+	CONDITION_VARIABLE mergeNeeded;
+	vector<int> buffer;
+	vector<vector<Run>> levels;
+	vector<bool> levelMerging;
+	vector<HANDLE> mergeThreads;
+	int sortThreadCount;
+	bool stop;
+
+	static DWORD WINAPI MergeThread(LPVOID param)
+	{
+		((SortedRuns*)param)->MergeLoop();
+		return 0;
+	}
+
+	int FindFullLevel()
+	{
+		for (size_t level = 0; level < levels.size(); level++)
+		{
+			if (!levelMerging[level] && levels[level].size() >= TIER_FANOUT)
+				return (int)level;
+		}
+		return -1;
+	}
+
+	void MergeLoop()
+	{
+		AcquireSRWLockExclusive(&lock);
+		while (!stop)
+		{
+			int level = FindFullLevel();
+			if (level < 0)
+			{
+				SleepConditionVariableSRW(&mergeNeeded, &lock, INFINITE, 0);
+				continue;
+			}
+
+			levelMerging[level] = true;
+			vector<Run> inputs(levels[level].begin(), levels[level].begin() + TIER_FANOUT);
+			ReleaseSRWLockExclusive(&lock);
+
+			vector<RunSlice> slices;
+			for (const Run& run : inputs)
+				slices.push_back(RunSlice(run->data(), run->data() + run->size()));
+			shared_ptr<vector<int>> merged = make_shared<vector<int>>();
+			MergeSlices(slices, *merged);
+
+			// Входные прогоны заменяются результатом за один захват блокировки,
+			// поэтому запрос видит либо их, либо слитый прогон
+			AcquireSRWLockExclusive(&lock);
+			vector<Run>& current = levels[level];
+			for (const Run& run : inputs)
+				current.erase(find(current.begin(), current.end(), run));
+			if (levels.size() == (size_t)level + 1)
+			{
+				levels.push_back(vector<Run>());
+				levelMerging.push_back(false);
+			}
+			levels[level + 1].push_back(merged);
+			levelMerging[level] = false;
+			WakeAllConditionVariable(&mergeNeeded);
+		}
+		ReleaseSRWLockExclusive(&lock);
+	}
+
+	// Вызывается под исключительной блокировкой
+	void PushRun(Run run)
+	{
+		if (run->empty())
+			return;
+		levels[0].push_back(run);
+		if (levels[0].size() >= TIER_FANOUT)
+			WakeConditionVariable(&mergeNeeded);
+	}
+
+	void Snapshot(vector<Run>& runs)
+	{
+		AcquireSRWLockShared(&lock);
+		for (const vector<Run>& level : levels)
+			runs.insert(runs.end(), level.begin(), level.end());
+		if (!buffer.empty())
+		{
+			shared_ptr<vector<int>> pending = make_shared<vector<int>>(buffer);
+			sort(pending->begin(), pending->end());
+			runs.push_back(pending);
+		}
+		ReleaseSRWLockShared(&lock);
+	}
+
+public:
+	// threadCount задает и число фоновых потоков слияния, и число частей
+	// при сортировке больших пакетов
+	SortedRuns(int threadCount) : levels(1), levelMerging(1, false), sortThreadCount(threadCount), stop(false)
+	{
+		InitializeSRWLock(&lock);
+		InitializeConditionVariable(&mergeNeeded);
+		buffer.reserve(RUN_SIZE);
+
+		for (int i = 0; i < threadCount; i++)
+		{
+			HANDLE thread = CreateThread(NULL, 0, MergeThread, this, 0, NULL);
+			if (thread != NULL)
+				mergeThreads.push_back(thread);
+		}
+	}
+
+	~SortedRuns()
+	{
+		AcquireSRWLockExclusive(&lock);
+		stop = true;
+		WakeAllConditionVariable(&mergeNeeded);
+		ReleaseSRWLockExclusive(&lock);
+
+		WaitForThreads(mergeThreads);
+	}
+
+	void Insert(int value)
+	{
+		AcquireSRWLockExclusive(&lock);
+		buffer.push_back(value);
+		if (buffer.size() >= RUN_SIZE)
+		{
+			shared_ptr<vector<int>> run = make_shared<vector<int>>();
+			run->swap(buffer);
+			buffer.reserve(RUN_SIZE);
+			sort(run->begin(), run->end());
+			PushRun(run);
+		}
+		ReleaseSRWLockExclusive(&lock);
+	}
+
+	// Пакет сортируется вне блокировки и сразу становится прогоном уровня 0.
+	// Большие пакеты сортируются по частям в нескольких потоках
+	void InsertBatch(vector<int> values)
+	{
+		shared_ptr<vector<int>> run = make_shared<vector<int>>(move(values));
+		if (sortThreadCount > 1 && run->size() >= CHUNKED_SORT_MIN)
+			ChunkedSort(*run, sortThreadCount);
+		else
+			sort(run->begin(), run->end());
+
+		AcquireSRWLockExclusive(&lock);
+		PushRun(run);
+		ReleaseSRWLockExclusive(&lock);
+	}
+
+	// Число элементов меньше value
+	size_t Rank(int value)
+	{
+		vector<Run> runs;
+		Snapshot(runs);
+
+		size_t rank = 0;
+		for (const Run& run : runs)
+			rank += lower_bound(run->begin(), run->end(), value) - run->begin();
+		return rank;
+	}
+
+	// Элементы из [low, high] в порядке возрастания
+	vector<int> Range(int low, int high)
+	{
+		if (low > high)
+			return vector<int>();
+
+		vector<Run> runs;
+		Snapshot(runs);
+
+		vector<RunSlice> slices;
+		for (const Run& run : runs)
+		{
+			const int* first = run->data();
+			const int* begin = lower_bound(first, first + run->size(), low);
+			const int* end = upper_bound(first, first + run->size(), high);
+			slices.push_back(RunSlice(begin, max(begin, end)));
+		}
+
+		vector<int> result;
+		MergeSlices(slices, result);
+		return result;
+	}
+
+	size_t RunCount()
+	{
+		AcquireSRWLockShared(&lock);
+		size_t count = 0;
+		for (const vector<Run>& level : levels)
+			count += level.size();
+		ReleaseSRWLockShared(&lock);
+		return count;
+	}
+};
+
+struct FeedData
+{
+	SortedRuns* container;
+	int batchCount;
+	int batchSize;
+};
+
+DWORD WINAPI FeedThread(LPVOID param)
+{
+	FeedData* data = (FeedData*)param;
+	mt19937 generator(random_device{}());
+	uniform_int_distribution<int> distribution(0, 1000000);
+
+	for (int i = 0; i < data->batchCount; i++)
+	{
+		vector<int> batch(data->batchSize);
+		for (int& value : batch)
+			value = distribution(generator);
+		data->container->InsertBatch(move(batch));
+	}
+
+	return 0;
+}
+
 double GetCPUUsage()
 {
 	static FILETIME prevIdleTime = { 0 }, prevKernelTime = { 0 }, prevUserTime = { 0 };
@@ -68,8 +398,63 @@ void DisplayCPUUsage() {
 
 
 
-int main()
+// Онлайн-режим: поток подачи вставляет пакеты, а главный поток
+// тем временем выполняет запросы ранга и диапазона
+int RunOnline()
 {
+	int batchCount;
+	int batchSize;
+	int count;
+
+	cout << "Enter number of batches: ";
+	cin >> batchCount;
+	cout << "Enter batch size: ";
+	cin >> batchSize;
+	cout << "Enter number of merge threads: ";
+	cin >> count;
+
+	if (!cin || batchCount <= 0 || batchSize <= 0 || count <= 0)
+	{
+		cerr << "Number of batches, batch size and number of merge threads must be positive integers" << endl;
+		return 1;
+	}
+
+	SortedRuns container(count);
+	FeedData data = { &container, batchCount, batchSize };
+
+	auto start = chrono::high_resolution_clock::now();
+	HANDLE feed = CreateThread(NULL, 0, FeedThread, &data, 0, NULL);
+	if (feed == NULL)
+	{
+		cerr << "Failed to start feed thread: " << GetLastError() << endl;
+		return 1;
+	}
+
+	while (WaitForSingleObject(feed, 800) == WAIT_TIMEOUT)
+	{
+		size_t rank = container.Rank(500000);
+		size_t inRange = container.Range(250000, 250100).size();
+		cout << "Runs: " << container.RunCount() << ", rank(500000): " << rank
+			<< ", items in [250000, 250100]: " << inRange << endl;
+		DisplayCPUUsage();
+	}
+
+	CloseHandle(feed);
+
+	auto end = chrono::high_resolution_clock::now();
+	chrono::duration<double> elapsed = end - start;
+
+	cout << "Inserted " << (long long)batchCount * batchSize << " items in: " << elapsed.count() << " seconds" << endl;
+	cout << "Runs: " << container.RunCount() << ", rank(500000): " << container.Rank(500000) << endl;
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && string(argv[1]) == "online")
+		return RunOnline();
+
 	int size;
 	int count;
 
@@ -82,34 +467,13 @@ int main()
 	iota(arr.begin(), arr.end(), 0);
 	random_shuffle(arr.begin(), arr.end());
 
-	int partSize = size / count;
-	vector<vector<int>> partsArr(count);
-
-	for (int i = 0; i < count; i++)
-	{
-		if (i == count - 1) {
-			partsArr[i].assign(arr.begin() + i * partSize, arr.end());
-		}
-		else {
-			partsArr[i].assign(arr.begin() + i * partSize, arr.begin() + (i + 1) * partSize);
-		}
-	}
-
-	vector<HANDLE> threads(count);
-	vector<Data> data(count);
-	for (int i = 0; i < count; i++)
-	{
-		data[i].TID = i;
-		data[i].isComplate = false;
-		data[i].part = &partsArr[i];
-	}
+	vector<vector<int>> partsArr;
+	vector<HANDLE> threads;
+	vector<Data> data;
 
 	auto start = chrono::high_resolution_clock::now();
 
-	for (int i = 0; i < count; i++)
-	{
-		threads[i] = CreateThread(NULL, 0, SortThread, &data[i], 0, NULL);
-	}
+	StartChunkedSort(arr, count, partsArr, data, threads);
 
 	while (true)
 	{
@@ -142,15 +506,11 @@ int main()
 		Sleep(800);
 	}
 
-	WaitForMultipleObjects(count, threads.data(), TRUE, INFINITE);
+	WaitForThreads(threads);
 
 	auto end = chrono::high_resolution_clock::now();
 	chrono::duration<double> elapsed = end - start;
 
-	for (int i = 0; i < count; i++) {
-		CloseHandle(threads[i]);
-	}
-
 	vector<int> sortedArray;
 	for (const auto& part : partsArr) {
 		sortedArray.insert(sortedArray.end(), part.begin(), part.end());
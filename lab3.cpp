@@ -1,12 +1,21 @@
 ﻿#include <windows.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <climits>
+#include <cstdlib>
 
 #define BUFFER_COUNT 3
 #define BUFFER_SIZE 256
 #define SHARED_MEMORY_NAME L"Local\\SharedMemoryExample"
 #define MUTEX_NAME L"Local\\BufferAccessMutex"
 #define SEMAPHORE_NAME L"Local\\BufferSemaphore"
+#define CHANNEL_SHARED_MEMORY_PREFIX L"Local\\SharedChannel_"
+#define CHANNEL_MUTEX_PREFIX L"Local\\SharedChannelMutex_"
+#define CHANNEL_SPACE_PREFIX L"Local\\SharedChannelSpace_"
+#define CHANNEL_NOTIFY_PREFIX L"Local\\SharedChannelNotify_"
+#define CHANNEL_MESSAGES 5
+#define POLL_BATCH 64
 
 using namespace std;
 
@@ -19,6 +28,24 @@ struct SharedMemory {
     SharedBuffer buffers[BUFFER_COUNT];
 };
 
+// Канал: сегмент с буферами и счетчиком заполненных буферов.
+// Счетчик меняется под мьютексом канала, по нему определяется переход "пустой -> непустой".
+struct SharedChannel {
+    SharedMemory memory;
+    LONG filled;
+};
+
+struct Channel {
+    int id;
+    HANDLE hMapFile;
+    SharedChannel* shared;
+    HANDLE hMutex;
+    HANDLE hSpace;   // свободные буферы, его ждет производитель
+    HANDLE hNotify;  // событие с автосбросом: канал стал непустым
+    HANDLE hWait;    // регистрация ожидания hNotify в пуле потоков
+    HANDLE hPort;    // порт завершения потребителя
+};
+
 void producer(SharedMemory* sharedMemory, HANDLE hSemaphore, HANDLE hMutex) {
     while (true) {
         WaitForSingleObject(hSemaphore, INFINITE);
@@ -55,9 +82,186 @@ void consumer(SharedMemory* sharedMemory, HANDLE hSemaphore, HANDLE hMutex) {
     }
 }
 
-int main() {
+// Имена объектов канала строятся из его номера, поэтому производитель в другом процессе
+// открывает тот же сегмент и то же событие уведомления по номеру канала.
+bool openChannel(int id, Channel& channel) {
+    wstring suffix = to_wstring(id);
+    channel = {};
+    channel.id = id;
+
+    // Новый сегмент на файле подкачки заполнен нулями: все буферы свободны, filled == 0
+    channel.hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(SharedChannel),
+        (CHANNEL_SHARED_MEMORY_PREFIX + suffix).c_str());
+    if (!channel.hMapFile) {
+        std::cerr << "Не удалось создать/открыть канал " << id << ": " << GetLastError() << "\n";
+        return false;
+    }
+
+    channel.shared = (SharedChannel*)MapViewOfFile(channel.hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedChannel));
+    channel.hMutex = CreateMutex(nullptr, FALSE, (CHANNEL_MUTEX_PREFIX + suffix).c_str());
+    channel.hSpace = CreateSemaphore(nullptr, BUFFER_COUNT, BUFFER_COUNT, (CHANNEL_SPACE_PREFIX + suffix).c_str());
+    channel.hNotify = CreateEvent(nullptr, FALSE, FALSE, (CHANNEL_NOTIFY_PREFIX + suffix).c_str());
+    if (!channel.shared || !channel.hMutex || !channel.hSpace || !channel.hNotify) {
+        std::cerr << "Не удалось подготовить канал " << id << ": " << GetLastError() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+void closeChannel(Channel& channel) {
+    if (channel.hWait) {
+        // INVALID_HANDLE_VALUE дожидается завершения уже запущенного обратного вызова
+        UnregisterWaitEx(channel.hWait, INVALID_HANDLE_VALUE);
+    }
+    if (channel.hNotify) CloseHandle(channel.hNotify);
+    if (channel.hSpace) CloseHandle(channel.hSpace);
+    if (channel.hMutex) CloseHandle(channel.hMutex);
+    if (channel.shared) UnmapViewOfFile(channel.shared);
+    if (channel.hMapFile) CloseHandle(channel.hMapFile);
+    channel = {};
+}
+
+void channelSend(Channel& channel, const string& message) {
+    WaitForSingleObject(channel.hSpace, INFINITE);
+
+    WaitForSingleObject(channel.hMutex, INFINITE);
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        if (!channel.shared->memory.buffers[i].inUse) {
+            strncpy_s(channel.shared->memory.buffers[i].data, BUFFER_SIZE, message.c_str(), BUFFER_SIZE - 1);
+            channel.shared->memory.buffers[i].inUse = true;
+            break;
+        }
+    }
+    // Уведомление только при переходе из пустого состояния, остальные записи объединяются с ним
+    bool wasEmpty = channel.shared->filled++ == 0;
+    ReleaseMutex(channel.hMutex);
+
+    if (wasEmpty) {
+        SetEvent(channel.hNotify);
+    }
+}
+
+// Забирает все заполненные буферы канала за один захват мьютекса
+int channelDrain(Channel& channel) {
+    int taken = 0;
+
+    WaitForSingleObject(channel.hMutex, INFINITE);
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        if (channel.shared->memory.buffers[i].inUse) {
+            cout << "Потребитель: канал " << channel.id << ", буфер " << i + 1 << ": " << channel.shared->memory.buffers[i].data << endl;
+            channel.shared->memory.buffers[i].inUse = false;
+            taken++;
+        }
+    }
+    channel.shared->filled -= taken;
+    ReleaseMutex(channel.hMutex);
+
+    if (taken > 0) {
+        ReleaseSemaphore(channel.hSpace, taken, nullptr);
+    }
+    return taken;
+}
+
+// Пул потоков ждет события каналов пачками, а сработавший канал ставится в порт завершения,
+// так что число потоков потребителя не зависит от числа каналов
+VOID CALLBACK ChannelSignaled(PVOID context, BOOLEAN timedOut) {
+    UNREFERENCED_PARAMETER(timedOut);
+    Channel* channel = (Channel*)context;
+    PostQueuedCompletionStatus(channel->hPort, 0, (ULONG_PTR)channel, nullptr);
+}
+
+bool registerChannel(Channel& channel, HANDLE hPort) {
+    channel.hPort = hPort;
+    if (!RegisterWaitForSingleObject(&channel.hWait, channel.hNotify, ChannelSignaled, &channel, INFINITE, WT_EXECUTEINWAITTHREAD)) {
+        std::cerr << "Не удалось зарегистрировать ожидание канала " << channel.id << ": " << GetLastError() << "\n";
+        channel.hWait = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void multiplexConsumer(HANDLE hPort, int expectedMessages) {
+    OVERLAPPED_ENTRY entries[POLL_BATCH];
+    int received = 0;
+
+    while (received < expectedMessages) {
+        ULONG count = 0;
+        if (!GetQueuedCompletionStatusEx(hPort, entries, POLL_BATCH, &count, INFINITE, FALSE)) {
+            std::cerr << "Ошибка ожидания порта завершения: " << GetLastError() << "\n";
+            return;
+        }
+
+        for (ULONG i = 0; i < count; ++i) {
+            received += channelDrain(*(Channel*)entries[i].lpCompletionKey);
+        }
+    }
+}
+
+DWORD WINAPI channelProducer(LPVOID param) {
+    Channel* channel = (Channel*)param;
+    for (int i = 0; i < CHANNEL_MESSAGES; ++i) {
+        channelSend(*channel, "канал_" + to_string(channel->id) + "_сообщение_" + to_string(i + 1));
+        Sleep(rand() % 50);
+    }
+    return 0;
+}
+
+// Режим мультиплексирования: channelCount производителей, один поток-потребитель
+int runMultiplexed(int channelCount) {
+    HANDLE hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!hPort) {
+        std::cerr << "Не удалось создать порт завершения: " << GetLastError() << "\n";
+        return 1;
+    }
+
+    vector<Channel> channels(channelCount);
+    for (int i = 0; i < channelCount; ++i) {
+        if (!openChannel(i, channels[i]) || !registerChannel(channels[i], hPort)) {
+            for (Channel& channel : channels) {
+                closeChannel(channel);
+            }
+            CloseHandle(hPort);
+            return 1;
+        }
+    }
+
+    vector<HANDLE> producers;
+    for (Channel& channel : channels) {
+        HANDLE hProducer = CreateThread(nullptr, 0, channelProducer, &channel, 0, nullptr);
+        if (hProducer != nullptr) {
+            producers.push_back(hProducer);
+        }
+    }
+
+    multiplexConsumer(hPort, (int)producers.size() * CHANNEL_MESSAGES);
+
+    for (HANDLE hProducer : producers) {
+        WaitForSingleObject(hProducer, INFINITE);
+        CloseHandle(hProducer);
+    }
+    for (Channel& channel : channels) {
+        closeChannel(channel);
+    }
+    CloseHandle(hPort);
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     setlocale(LC_ALL, "Russian");
 
+    // "lab3 poll N": N каналов обслуживаются одним потоком-потребителем
+    if (argc > 1 && string(argv[1]) == "poll") {
+        char* end = nullptr;
+        long channelCount = argc > 2 ? strtol(argv[2], &end, 10) : 0;
+        if (argc != 3 || *end != '\0' || channelCount <= 0 || channelCount > INT_MAX) {
+            std::cerr << "Использование: " << argv[0] << " poll <число каналов > 0>\n";
+            return 1;
+        }
+        return runMultiplexed((int)channelCount);
+    }
+
     HANDLE hMapFile = CreateFileMapping(
         INVALID_HANDLE_VALUE,
         nullptr,
@@ -4,29 +4,445 @@
 #include <random>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+
+// Формат постоянного хранилища: страница заголовка, за ней блоки данных.
+// Рядом лежат два сегмента журнала упреждающей записи <файл>.wal.0 и <файл>.wal.1
+// из записей фиксированного размера: пока контрольная точка сбрасывает старый сегмент,
+// новые записи идут во второй.
+const uint32_t STORE_MAGIC = 0x4B4C4253;
+const uint32_t WAL_MAGIC = 0x4C415757;
+const ULONGLONG STORE_HEADER_SIZE = 4096;
+const ULONGLONG CHECKPOINT_LOG_BYTES = 64ULL * 1024 * 1024;
+const size_t RECOVERY_CHUNK_RECORDS = 1024;
+const int LOG_SEGMENTS = 2;
+
+// storeId связывает журнал с файлом данных: записи чужого хранилища не повторяются
+struct StoreHeader {
+    uint32_t magic;
+    uint32_t blockSize;
+    uint64_t blockCount;
+    uint64_t checkpointLsn;
+    uint64_t storeId;
+};
+
+struct WalRecordHeader {
+    uint32_t magic;
+    uint32_t blockIndex;
+    uint64_t lsn;
+    uint64_t storeId;
+    uint32_t checksum;
+    uint32_t batchRemaining;
+};
+
+uint32_t walChecksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
 
 class SharedMemory {
 private:
     HANDLE hMapFile;
+    void* pView;
     int* pMemory;     
     int blockSize;
-    int successfulReads = 0;
-    int unsuccessfulReads = 0;
-    int successfulWrites = 0;
-    int unsuccessfulWrites = 0;
+    volatile LONG successfulReads = 0;
+    volatile LONG unsuccessfulReads = 0;
+    volatile LONG successfulWrites = 0;
+    volatile LONG unsuccessfulWrites = 0;
     int blockCount;
 
+    // Блокировки отдельных блоков; пакетные операции берут их по возрастанию индекса
+    std::vector<SRWLOCK> blockLocks;
+
+    // Постоянный режим: файл данных, сегменты журнала и групповая фиксация.
+    // Записи попадают в отображение только после сброса журнала на диск,
+    // поэтому в файле данных не бывает блока без надежной записи в журнале.
+    bool persistent = false;
+    HANDLE hDataFile = INVALID_HANDLE_VALUE;
+    HANDLE hLogFiles[LOG_SEGMENTS] = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE };
+    bool segmentDirty[LOG_SEGMENTS] = { false, false };
+    int activeSegment = 0;
+    StoreHeader* pHeader = nullptr;
+    CRITICAL_SECTION logLock;
+    CRITICAL_SECTION checkpointLock;
+    CONDITION_VARIABLE flushRequested;
+    CONDITION_VARIABLE flushDone;
+    CONDITION_VARIABLE checkpointRequested;
+    HANDLE hFlusherThread = NULL;
+    HANDLE hCheckpointThread = NULL;
+    bool stopFlusher = false;
+    bool stopCheckpointer = false;
+    bool checkpointPending = false;
+    uint64_t nextLsn = 1;
+    uint64_t appendedLsn = 0;
+    uint64_t durableLsn = 0;          // записи до этого LSN сброшены в журнал и применены к отображению
+    ULONGLONG logBytes = 0;           // размер активного сегмента
+    std::vector<char> stagedRecords;  // записи в журнале, еще не примененные к отображению
+
+    size_t blockBytes() const {
+        return static_cast<size_t>(blockSize) * sizeof(int);
+    }
+
+    size_t recordSize() const {
+        return sizeof(WalRecordHeader) + blockBytes();
+    }
+
+    int* blockAddress(int blockIndex) const {
+        return pMemory + static_cast<size_t>(blockIndex) * blockSize;
+    }
+
+    void initBlockLocks() {
+        blockLocks.resize(blockCount);
+        for (SRWLOCK& lock : blockLocks) {
+            InitializeSRWLock(&lock);
+        }
+    }
+
+    bool indicesInRange(const std::vector<int>& blockIndices) const {
+        for (int blockIndex : blockIndices) {
+            if (blockIndex < 0 || blockIndex >= blockCount) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Единый порядок захвата блокировок исключает взаимоблокировку пакетов
+    void lockBlocks(const std::vector<int>& sortedBlocks, bool exclusive) {
+        for (int blockIndex : sortedBlocks) {
+            if (exclusive) {
+                AcquireSRWLockExclusive(&blockLocks[blockIndex]);
+            }
+            else {
+                AcquireSRWLockShared(&blockLocks[blockIndex]);
+            }
+        }
+    }
+
+    void unlockBlocks(const std::vector<int>& sortedBlocks, bool exclusive) {
+        for (auto it = sortedBlocks.rbegin(); it != sortedBlocks.rend(); ++it) {
+            if (exclusive) {
+                ReleaseSRWLockExclusive(&blockLocks[*it]);
+            }
+            else {
+                ReleaseSRWLockShared(&blockLocks[*it]);
+            }
+        }
+    }
+
+    // Подгружает страницы пакета заранее, до захвата блокировок;
+    // соседние блоки объединяются в один диапазон
+    void prefetchBlocks(const std::vector<int>& sortedBlocks) {
+        std::vector<WIN32_MEMORY_RANGE_ENTRY> ranges;
+        for (size_t i = 0; i < sortedBlocks.size(); ++i) {
+            if (i > 0 && sortedBlocks[i] == sortedBlocks[i - 1] + 1) {
+                ranges.back().NumberOfBytes += blockBytes();
+                continue;
+            }
+            WIN32_MEMORY_RANGE_ENTRY range;
+            range.VirtualAddress = blockAddress(sortedBlocks[i]);
+            range.NumberOfBytes = blockBytes();
+            ranges.push_back(range);
+        }
+        if (!ranges.empty()) {
+            PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0);
+        }
+    }
+
+    static DWORD WINAPI flusherThread(LPVOID lpParam) {
+        static_cast<SharedMemory*>(lpParam)->flusherLoop();
+        return 0;
+    }
+
+    static DWORD WINAPI checkpointThread(LPVOID lpParam) {
+        static_cast<SharedMemory*>(lpParam)->checkpointerLoop();
+        return 0;
+    }
+
+    void fail(const char* message) {
+        std::cerr << message << ": " << GetLastError() << std::endl;
+        exit(1);
+    }
+
+    void flusherLoop() {
+        std::vector<char> applying;
+        EnterCriticalSection(&logLock);
+        while (true) {
+            while (!stopFlusher && appendedLsn == durableLsn) {
+                SleepConditionVariableCS(&flushRequested, &logLock, INFINITE);
+            }
+            if (appendedLsn == durableLsn) {
+                break;
+            }
+
+            // Один сброс фиксирует все записи, накопленные с предыдущего сброса
+            uint64_t target = appendedLsn;
+            applying.swap(stagedRecords);
+            bool flushSegment[LOG_SEGMENTS];
+            for (int i = 0; i < LOG_SEGMENTS; ++i) {
+                flushSegment[i] = segmentDirty[i];
+                segmentDirty[i] = false;
+            }
+            LeaveCriticalSection(&logLock);
+
+            for (int i = 0; i < LOG_SEGMENTS; ++i) {
+                if (flushSegment[i] && !FlushFileBuffers(hLogFiles[i])) {
+                    fail("Не удалось сбросить журнал на диск");
+                }
+            }
+            applyRecords(applying.data(), applying.size());
+            applying.clear();
+
+            EnterCriticalSection(&logLock);
+            durableLsn = target;
+            WakeAllConditionVariable(&flushDone);
+
+            if (logBytes >= CHECKPOINT_LOG_BYTES && !checkpointPending) {
+                checkpointPending = true;
+                WakeConditionVariable(&checkpointRequested);
+            }
+        }
+        LeaveCriticalSection(&logLock);
+    }
+
+    void checkpointerLoop() {
+        EnterCriticalSection(&logLock);
+        while (true) {
+            while (!stopCheckpointer && !checkpointPending) {
+                SleepConditionVariableCS(&checkpointRequested, &logLock, INFINITE);
+            }
+            if (stopCheckpointer) {
+                break;
+            }
+            LeaveCriticalSection(&logLock);
+            checkpoint();
+            EnterCriticalSection(&logLock);
+            checkpointPending = false;
+        }
+        LeaveCriticalSection(&logLock);
+    }
+
+    // Копирует блоки из последовательности записей журнала в отображение.
+    // Пакет применяется под исключительными блокировками всех своих блоков,
+    // взятыми по возрастанию индекса, поэтому читатель пакета видит его целиком или никак.
+    void applyRecords(const char* records, size_t size) {
+        std::vector<int> sortedBlocks;
+        size_t batchStart = 0;
+        for (size_t offset = 0; offset < size; offset += recordSize()) {
+            const WalRecordHeader* record = reinterpret_cast<const WalRecordHeader*>(records + offset);
+            sortedBlocks.push_back(static_cast<int>(record->blockIndex));
+            if (record->batchRemaining != 0) {
+                continue;
+            }
+
+            std::sort(sortedBlocks.begin(), sortedBlocks.end());
+            sortedBlocks.erase(std::unique(sortedBlocks.begin(), sortedBlocks.end()), sortedBlocks.end());
+            lockBlocks(sortedBlocks, true);
+            for (size_t applied = batchStart; applied <= offset; applied += recordSize()) {
+                const WalRecordHeader* batchRecord = reinterpret_cast<const WalRecordHeader*>(records + applied);
+                memcpy(blockAddress(static_cast<int>(batchRecord->blockIndex)),
+                    records + applied + sizeof(WalRecordHeader), blockBytes());
+            }
+            unlockBlocks(sortedBlocks, true);
+
+            sortedBlocks.clear();
+            batchStart = offset + recordSize();
+        }
+    }
+
+    // Пишет записи пакета в активный сегмент журнала одним вызовом. В отображение они
+    // попадают из потока сброса, когда журнал уже на диске.
+    // batchRemaining у последней записи равен нулю: восстановление применяет пакет целиком или никак.
+    uint64_t appendToLog(const std::vector<int>& blockIndices, const std::vector<const int*>& blockData) {
+        EnterCriticalSection(&logLock);
+        size_t count = blockIndices.size();
+        size_t batchBytes = recordSize() * count;
+        size_t start = stagedRecords.size();
+        stagedRecords.resize(start + batchBytes);
+
+        for (size_t i = 0; i < count; ++i) {
+            char* raw = stagedRecords.data() + start + i * recordSize();
+            WalRecordHeader* record = reinterpret_cast<WalRecordHeader*>(raw);
+            record->magic = WAL_MAGIC;
+            record->blockIndex = static_cast<uint32_t>(blockIndices[i]);
+            record->lsn = nextLsn++;
+            record->storeId = pHeader->storeId;
+            record->checksum = 0;
+            record->batchRemaining = static_cast<uint32_t>(count - 1 - i);
+            memcpy(raw + sizeof(WalRecordHeader), blockData[i], blockBytes());
+            record->checksum = walChecksum(raw, recordSize());
+        }
+
+        DWORD written = 0;
+        if (!WriteFile(hLogFiles[activeSegment], stagedRecords.data() + start, static_cast<DWORD>(batchBytes), &written, NULL) ||
+            written != batchBytes) {
+            fail("Не удалось записать в журнал");
+        }
+        segmentDirty[activeSegment] = true;
+        logBytes += written;
+
+        uint64_t lsn = nextLsn - 1;
+        appendedLsn = lsn;
+        WakeConditionVariable(&flushRequested);
+        LeaveCriticalSection(&logLock);
+        return lsn;
+    }
+
+    void waitDurable(uint64_t lsn) {
+        EnterCriticalSection(&logLock);
+        while (durableLsn < lsn) {
+            SleepConditionVariableCS(&flushDone, &logLock, INFINITE);
+        }
+        LeaveCriticalSection(&logLock);
+    }
+
+    void flushData() {
+        if (!FlushViewOfFile(pView, 0) || !FlushFileBuffers(hDataFile)) {
+            fail("Не удалось сбросить файл данных");
+        }
+    }
+
+    void writeCheckpointLsn(uint64_t checkpointLsn) {
+        pHeader->checkpointLsn = checkpointLsn;
+        if (!FlushViewOfFile(pHeader, sizeof(StoreHeader)) || !FlushFileBuffers(hDataFile)) {
+            fail("Не удалось записать заголовок хранилища");
+        }
+    }
+
+    void truncateSegment(int segment) {
+        LARGE_INTEGER zero = {};
+        if (!SetFilePointerEx(hLogFiles[segment], zero, NULL, FILE_BEGIN) || !SetEndOfFile(hLogFiles[segment]) ||
+            !FlushFileBuffers(hLogFiles[segment])) {
+            fail("Не удалось обрезать журнал");
+        }
+    }
+
+    // LSN первой записи сегмента этого хранилища или UINT64_MAX, если такой записи нет
+    uint64_t firstSegmentLsn(int segment) {
+        WalRecordHeader record;
+        DWORD bytesRead = 0;
+        LARGE_INTEGER zero = {};
+        bool found = ReadFile(hLogFiles[segment], &record, sizeof(record), &bytesRead, NULL) &&
+            bytesRead == sizeof(record) && record.magic == WAL_MAGIC && record.storeId == pHeader->storeId;
+        SetFilePointerEx(hLogFiles[segment], zero, NULL, FILE_BEGIN);
+        return found ? record.lsn : UINT64_MAX;
+    }
+
+    // Повторяет записи сегмента после seenLsn; возвращает true, если достигнут конец журнала:
+    // неполная, поврежденная или чужая запись либо разрыв в LSN
+    bool replaySegment(int segment, uint64_t& lastLsn, uint64_t& seenLsn, std::vector<char>& pending, int& replayed) {
+        std::vector<char> chunk(recordSize() * RECOVERY_CHUNK_RECORDS);
+        while (true) {
+            DWORD bytesRead = 0;
+            if (!ReadFile(hLogFiles[segment], chunk.data(), static_cast<DWORD>(chunk.size()), &bytesRead, NULL)) {
+                fail("Не удалось прочитать журнал");
+            }
+
+            for (size_t offset = 0; offset + recordSize() <= bytesRead; offset += recordSize()) {
+                char* raw = chunk.data() + offset;
+                WalRecordHeader* record = reinterpret_cast<WalRecordHeader*>(raw);
+                uint32_t checksum = record->checksum;
+                record->checksum = 0;
+                if (record->magic != WAL_MAGIC || walChecksum(raw, recordSize()) != checksum ||
+                    record->storeId != pHeader->storeId || record->blockIndex >= static_cast<uint32_t>(blockCount)) {
+                    return true;
+                }
+
+                // Записи до контрольной точки остаются, если сбой произошел до обрезки сегмента
+                if (record->lsn <= pHeader->checkpointLsn) {
+                    continue;
+                }
+                if (record->lsn != seenLsn + 1) {
+                    return true;
+                }
+                seenLsn = record->lsn;
+                pending.insert(pending.end(), raw, raw + recordSize());
+                if (record->batchRemaining != 0) {
+                    continue;
+                }
+
+                applyRecords(pending.data(), pending.size());
+                replayed += static_cast<int>(pending.size() / recordSize());
+                lastLsn = seenLsn;
+                pending.clear();
+            }
+
+            if (bytesRead < chunk.size()) {
+                // Незавершенный пакет в конце сегмента означает оборванный хвост
+                return !pending.empty() || bytesRead % recordSize() != 0;
+            }
+        }
+    }
+
+    // Повторяет только хвост журнала после последней контрольной точки, сегменты по порядку LSN.
+    // Незавершенный пакет в хвосте отбрасывается. Затем повторенные блоки сбрасываются
+    // в файл данных, и оба сегмента обрезаются.
+    void recoverFromLog() {
+        int order[LOG_SEGMENTS] = { 0, 1 };
+        if (firstSegmentLsn(1) < firstSegmentLsn(0)) {
+            std::swap(order[0], order[1]);
+        }
+
+        uint64_t lastLsn = pHeader->checkpointLsn;
+        uint64_t seenLsn = lastLsn;
+        int replayed = 0;
+        std::vector<char> pending;
+        for (int segment : order) {
+            if (replaySegment(segment, lastLsn, seenLsn, pending, replayed)) {
+                break;
+            }
+        }
+
+        if (replayed > 0) {
+            flushData();
+        }
+        writeCheckpointLsn(lastLsn);
+        for (int segment = 0; segment < LOG_SEGMENTS; ++segment) {
+            truncateSegment(segment);
+        }
+
+        activeSegment = 0;
+        logBytes = 0;
+        nextLsn = lastLsn + 1;
+        appendedLsn = lastLsn;
+        durableLsn = lastLsn;
+
+        if (replayed > 0) {
+            std::cout << "Восстановлено записей из журнала: " << replayed << std::endl;
+        }
+    }
+
+    static int blockCountFor(size_t totalSize, int blockSize) {
+        size_t count = totalSize / blockSize;
+        if (count > INT_MAX) {
+            std::cerr << "Слишком много блоков: индекс блока должен помещаться в int." << std::endl;
+            exit(1);
+        }
+        return static_cast<int>(count);
+    }
+
 public:
-    SharedMemory(int totalSize, int blockSize) : blockSize(blockSize) {
-        blockCount = totalSize / blockSize;
+    // totalSize задается в значениях int
+    SharedMemory(size_t totalSize, int blockSize) : blockSize(blockSize) {
+        blockCount = blockCountFor(totalSize, blockSize);
+        ULONGLONG totalBytes = static_cast<ULONGLONG>(blockCount) * blockBytes();
 
         // Создаем объект общей памяти
         hMapFile = CreateFileMapping(
             INVALID_HANDLE_VALUE,   
             NULL,                   
             PAGE_READWRITE,        
-            0,                     
-            totalSize,         
+            static_cast<DWORD>(totalBytes >> 32),
+            static_cast<DWORD>(totalBytes & 0xFFFFFFFF),
             TEXT("SharedMemory"));  
 
         if (hMapFile == NULL) {
@@ -39,41 +455,204 @@ public:
             FILE_MAP_ALL_ACCESS,   
             0,                      
             0,                      
-            totalSize));           
+            0));           
 
         if (pMemory == NULL) {
             std::cerr << "Не удалось отобразить общую память." << std::endl;
             CloseHandle(hMapFile);
             exit(1);
         }
+        pView = pMemory;
+        initBlockLocks();
+    }
+
+    // Постоянный режим: блоки отображаются из файла dataPath и переживают перезапуск
+    SharedMemory(size_t totalSize, int blockSize, const std::string& dataPath) : blockSize(blockSize), persistent(true) {
+        blockCount = blockCountFor(totalSize, blockSize);
+        ULONGLONG fileBytes = STORE_HEADER_SIZE + static_cast<ULONGLONG>(blockCount) * blockBytes();
+
+        hDataFile = CreateFileA(dataPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hDataFile == INVALID_HANDLE_VALUE) {
+            std::cerr << "Не удалось открыть файл хранилища: " << GetLastError() << std::endl;
+            exit(1);
+        }
+
+        LARGE_INTEGER existingSize;
+        if (!GetFileSizeEx(hDataFile, &existingSize)) {
+            std::cerr << "Не удалось получить размер файла хранилища." << std::endl;
+            CloseHandle(hDataFile);
+            exit(1);
+        }
+        bool freshStore = existingSize.QuadPart == 0;
+        if (!freshStore && static_cast<ULONGLONG>(existingSize.QuadPart) != fileBytes) {
+            std::cerr << "Размер файла хранилища не совпадает с конфигурацией." << std::endl;
+            CloseHandle(hDataFile);
+            exit(1);
+        }
+
+        hMapFile = CreateFileMapping(
+            hDataFile,
+            NULL,
+            PAGE_READWRITE,
+            static_cast<DWORD>(fileBytes >> 32),
+            static_cast<DWORD>(fileBytes & 0xFFFFFFFF),
+            NULL);
+
+        if (hMapFile == NULL) {
+            std::cerr << "Не удалось отобразить файл хранилища." << std::endl;
+            CloseHandle(hDataFile);
+            exit(1);
+        }
+
+        pView = MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (pView == NULL) {
+            std::cerr << "Не удалось отобразить файл хранилища в память." << std::endl;
+            CloseHandle(hMapFile);
+            CloseHandle(hDataFile);
+            exit(1);
+        }
+        pHeader = static_cast<StoreHeader*>(pView);
+        pMemory = reinterpret_cast<int*>(static_cast<char*>(pView) + STORE_HEADER_SIZE);
+
+        if (freshStore) {
+            std::random_device device;
+            pHeader->magic = STORE_MAGIC;
+            pHeader->blockSize = static_cast<uint32_t>(blockSize);
+            pHeader->blockCount = static_cast<uint64_t>(blockCount);
+            pHeader->checkpointLsn = 0;
+            pHeader->storeId = (static_cast<uint64_t>(device()) << 32) | device();
+            FlushViewOfFile(pHeader, sizeof(StoreHeader));
+            FlushFileBuffers(hDataFile);
+        }
+        else if (pHeader->magic != STORE_MAGIC || pHeader->blockSize != static_cast<uint32_t>(blockSize) ||
+            pHeader->blockCount != static_cast<uint64_t>(blockCount)) {
+            std::cerr << "Файл хранилища поврежден или создан с другими параметрами." << std::endl;
+            UnmapViewOfFile(pView);
+            CloseHandle(hMapFile);
+            CloseHandle(hDataFile);
+            exit(1);
+        }
+
+        for (int segment = 0; segment < LOG_SEGMENTS; ++segment) {
+            std::string logPath = dataPath + ".wal." + std::to_string(segment);
+            hLogFiles[segment] = CreateFileA(logPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (hLogFiles[segment] == INVALID_HANDLE_VALUE) {
+                fail("Не удалось открыть журнал");
+            }
+        }
+
+        initBlockLocks();
+        InitializeCriticalSection(&logLock);
+        InitializeCriticalSection(&checkpointLock);
+        InitializeConditionVariable(&flushRequested);
+        InitializeConditionVariable(&flushDone);
+        InitializeConditionVariable(&checkpointRequested);
+
+        // Журнал рядом с новым файлом данных остался от другого хранилища и не повторяется
+        if (freshStore) {
+            for (int segment = 0; segment < LOG_SEGMENTS; ++segment) {
+                truncateSegment(segment);
+            }
+        }
+        else {
+            recoverFromLog();
+        }
+
+        hFlusherThread = CreateThread(NULL, 0, flusherThread, this, 0, NULL);
+        hCheckpointThread = CreateThread(NULL, 0, checkpointThread, this, 0, NULL);
+        if (hFlusherThread == NULL || hCheckpointThread == NULL) {
+            std::cerr << "Не удалось запустить потоки журнала." << std::endl;
+            exit(1);
+        }
     }
 
     ~SharedMemory() {
-        UnmapViewOfFile(pMemory);
+        if (persistent) {
+            EnterCriticalSection(&logLock);
+            stopCheckpointer = true;
+            WakeConditionVariable(&checkpointRequested);
+            LeaveCriticalSection(&logLock);
+            WaitForSingleObject(hCheckpointThread, INFINITE);
+            CloseHandle(hCheckpointThread);
+
+            checkpoint();
+
+            EnterCriticalSection(&logLock);
+            stopFlusher = true;
+            WakeConditionVariable(&flushRequested);
+            LeaveCriticalSection(&logLock);
+            WaitForSingleObject(hFlusherThread, INFINITE);
+            CloseHandle(hFlusherThread);
+
+            for (HANDLE hLogFile : hLogFiles) {
+                CloseHandle(hLogFile);
+            }
+            DeleteCriticalSection(&checkpointLock);
+            DeleteCriticalSection(&logLock);
+        }
+
+        UnmapViewOfFile(pView);
         CloseHandle(hMapFile);
+        if (persistent) {
+            CloseHandle(hDataFile);
+        }
+    }
+
+    // Переносит журнал в файл данных, не задерживая писателей на время сброса:
+    // под logLock только переключается активный сегмент, файл данных сбрасывается без блокировок,
+    // затем LSN контрольной точки пишется в заголовок и обрезается старый сегмент.
+    // Записи после этого LSN остаются в новом сегменте.
+    void checkpoint() {
+        if (!persistent) {
+            return;
+        }
+        EnterCriticalSection(&checkpointLock);
+
+        EnterCriticalSection(&logLock);
+        uint64_t checkpointLsn = appendedLsn;
+        int oldSegment = activeSegment;
+        activeSegment = (activeSegment + 1) % LOG_SEGMENTS;
+        logBytes = 0;
+        LeaveCriticalSection(&logLock);
+
+        // Старый сегмент больше не пополняется; ждем, пока его записи окажутся в отображении
+        waitDurable(checkpointLsn);
+        flushData();
+        writeCheckpointLsn(checkpointLsn);
+        truncateSegment(oldSegment);
+
+        LeaveCriticalSection(&checkpointLock);
     }
 
     int getBlockCount() const {
         return blockCount;
     }
 
+    int getBlockSize() const {
+        return blockSize;
+    }
+
     void readBlock(int blockIndex, int readerId, HANDLE coutMutex) {
         WaitForSingleObject(coutMutex, INFINITE);
         std::cout << "Читатель " << readerId << " читает блок " << blockIndex << ": ";
         bool blockEmpty = true;
-        for (int i = blockIndex * blockSize; i < (blockIndex + 1) * blockSize; ++i) {
+        AcquireSRWLockShared(&blockLocks[blockIndex]);
+        for (size_t i = static_cast<size_t>(blockIndex) * blockSize; i < static_cast<size_t>(blockIndex + 1) * blockSize; ++i) {
             std::cout << pMemory[i] << " ";
             if (pMemory[i] != 0) {
                 blockEmpty = false;
             }
         }
+        ReleaseSRWLockShared(&blockLocks[blockIndex]);
         std::cout << std::endl;
 
         if (blockEmpty) {
-            unsuccessfulReads++;
+            InterlockedIncrement(&unsuccessfulReads);
         }
         else {
-            successfulReads++;
+            InterlockedIncrement(&successfulReads);
         }
 
         ReleaseMutex(coutMutex);  
@@ -84,12 +663,100 @@ public:
         int value = rand() % 1000;
         std::cout << "Писатель " << writerId << " записывает в блок " << blockIndex << ": " << value << std::endl;
 
-        for (int i = blockIndex * blockSize; i < (blockIndex + 1) * blockSize; ++i) {
-            pMemory[i] = value;
+        uint64_t lsn = 0;
+        if (persistent) {
+            std::vector<int> block(blockSize, value);
+            lsn = appendToLog({ blockIndex }, { block.data() });
+        }
+        else {
+            AcquireSRWLockExclusive(&blockLocks[blockIndex]);
+            for (size_t i = static_cast<size_t>(blockIndex) * blockSize; i < static_cast<size_t>(blockIndex + 1) * blockSize; ++i) {
+                pMemory[i] = value;
+            }
+            ReleaseSRWLockExclusive(&blockLocks[blockIndex]);
         }
 
-        successfulWrites++;
+        InterlockedIncrement(&successfulWrites);
         ReleaseMutex(coutMutex);  
+
+        // Ожидание фиксации вне мьютекса, чтобы писатели делили один сброс журнала
+        if (persistent) {
+            waitDurable(lsn);
+        }
+    }
+
+    // Пакетное чтение: buffers[i] получает копию блока blockIndices[i] (blockSize значений).
+    // Все блоки пакета удерживаются одновременно, поэтому пакетная запись видна целиком или никак.
+    bool readBlocks(const std::vector<int>& blockIndices, const std::vector<int*>& buffers) {
+        if (blockIndices.size() != buffers.size() || !indicesInRange(blockIndices)) {
+            InterlockedExchangeAdd(&unsuccessfulReads, static_cast<LONG>(blockIndices.size()));
+            return false;
+        }
+
+        std::vector<int> sortedBlocks(blockIndices);
+        std::sort(sortedBlocks.begin(), sortedBlocks.end());
+        sortedBlocks.erase(std::unique(sortedBlocks.begin(), sortedBlocks.end()), sortedBlocks.end());
+
+        prefetchBlocks(sortedBlocks);
+        lockBlocks(sortedBlocks, false);
+        for (size_t i = 0; i < blockIndices.size(); ++i) {
+            memcpy(buffers[i], blockAddress(blockIndices[i]), blockBytes());
+        }
+        unlockBlocks(sortedBlocks, false);
+
+        LONG emptyBlocks = 0;
+        for (int* buffer : buffers) {
+            if (std::all_of(buffer, buffer + blockSize, [](int value) { return value == 0; })) {
+                emptyBlocks++;
+            }
+        }
+        InterlockedExchangeAdd(&unsuccessfulReads, emptyBlocks);
+        InterlockedExchangeAdd(&successfulReads, static_cast<LONG>(buffers.size()) - emptyBlocks);
+        return true;
+    }
+
+    // Атомарная пакетная запись: buffers[i] (blockSize значений) записывается в блок blockIndices[i].
+    // При повторе индекса побеждает последнее вхождение.
+    bool writeBlocks(const std::vector<int>& blockIndices, const std::vector<const int*>& buffers) {
+        if (blockIndices.size() != buffers.size() || !indicesInRange(blockIndices)) {
+            InterlockedExchangeAdd(&unsuccessfulWrites, static_cast<LONG>(blockIndices.size()));
+            return false;
+        }
+
+        std::vector<size_t> positions(blockIndices.size());
+        std::iota(positions.begin(), positions.end(), 0);
+        std::stable_sort(positions.begin(), positions.end(),
+            [&blockIndices](size_t a, size_t b) { return blockIndices[a] < blockIndices[b]; });
+
+        std::vector<int> sortedBlocks;
+        std::vector<const int*> sources;
+        for (size_t position : positions) {
+            if (!sortedBlocks.empty() && sortedBlocks.back() == blockIndices[position]) {
+                sources.back() = buffers[position];
+            }
+            else {
+                sortedBlocks.push_back(blockIndices[position]);
+                sources.push_back(buffers[position]);
+            }
+        }
+        if (sortedBlocks.empty()) {
+            return true;
+        }
+
+        // В постоянном режиме отображение меняет поток сброса, подкачка здесь не нужна
+        if (persistent) {
+            waitDurable(appendToLog(sortedBlocks, sources));
+        }
+        else {
+            prefetchBlocks(sortedBlocks);
+            lockBlocks(sortedBlocks, true);
+            for (size_t i = 0; i < sortedBlocks.size(); ++i) {
+                memcpy(blockAddress(sortedBlocks[i]), sources[i], blockBytes());
+            }
+            unlockBlocks(sortedBlocks, true);
+        }
+        InterlockedExchangeAdd(&successfulWrites, static_cast<LONG>(sortedBlocks.size()));
+        return true;
     }
 
     void printStatistics() {
@@ -133,7 +800,84 @@ DWORD WINAPI writerTask(LPVOID lpParam) {
     return 0;
 }
 
-int main() {
+// Значения пакетного писателя не пересекаются со значениями writeBlock (0..999)
+const int BATCH_STAMP_BASE = 1000;
+
+// Пакетный писатель: атомарно заполняет все блоки значением-меткой очередного пакета
+DWORD WINAPI batchWriterTask(LPVOID lpParam) {
+    auto params = static_cast<std::tuple<SharedMemory*, int, HANDLE>*>(lpParam);
+    SharedMemory* sharedMemory = std::get<0>(*params);
+    int writerId = std::get<1>(*params);
+    HANDLE coutMutex = std::get<2>(*params);
+
+    int blockCount = sharedMemory->getBlockCount();
+    int blockSize = sharedMemory->getBlockSize();
+    std::vector<int> blockIndices(blockCount);
+    std::iota(blockIndices.rbegin(), blockIndices.rend(), 0);
+    std::vector<int> data(static_cast<size_t>(blockCount) * blockSize);
+    std::vector<const int*> sources;
+    for (int i = 0; i < blockCount; ++i) {
+        sources.push_back(data.data() + static_cast<size_t>(i) * blockSize);
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        int stamp = BATCH_STAMP_BASE + i;
+        std::fill(data.begin(), data.end(), stamp);
+        sharedMemory->writeBlocks(blockIndices, sources);
+
+        WaitForSingleObject(coutMutex, INFINITE);
+        std::cout << "Пакетный писатель " << writerId << " записал пакет " << stamp << " в " << blockCount << " блоков" << std::endl;
+        ReleaseMutex(coutMutex);
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    }
+
+    return 0;
+}
+
+// Пакетный читатель: читает все блоки одним снимком. writeBlock может перезаписать часть блоков
+// после пакета, но все оставшиеся метки в снимке обязаны принадлежать одному пакету
+DWORD WINAPI batchReaderTask(LPVOID lpParam) {
+    auto params = static_cast<std::tuple<SharedMemory*, int, HANDLE>*>(lpParam);
+    SharedMemory* sharedMemory = std::get<0>(*params);
+    int readerId = std::get<1>(*params);
+    HANDLE coutMutex = std::get<2>(*params);
+
+    int blockCount = sharedMemory->getBlockCount();
+    int blockSize = sharedMemory->getBlockSize();
+    std::vector<int> blockIndices(blockCount);
+    std::iota(blockIndices.begin(), blockIndices.end(), 0);
+    std::vector<int> snapshot(static_cast<size_t>(blockCount) * blockSize);
+    std::vector<int*> buffers;
+    for (int i = 0; i < blockCount; ++i) {
+        buffers.push_back(snapshot.data() + static_cast<size_t>(i) * blockSize);
+    }
+
+    for (int i = 0; i < 10; ++i) {
+        sharedMemory->readBlocks(blockIndices, buffers);
+
+        int stamp = -1;
+        bool consistent = true;
+        for (int value : snapshot) {
+            if (value < BATCH_STAMP_BASE) {
+                continue;
+            }
+            if (stamp >= 0 && value != stamp) {
+                consistent = false;
+            }
+            stamp = value;
+        }
+
+        WaitForSingleObject(coutMutex, INFINITE);
+        std::cout << "Пакетный читатель " << readerId << ": "
+            << (consistent ? "снимок согласован" : "пакетная запись видна частично") << std::endl;
+        ReleaseMutex(coutMutex);
+        std::this_thread::sleep_for(std::chrono::milliseconds(75));
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     int memorySize = 20;
     int blockSize = 5;
 
@@ -146,23 +890,32 @@ int main() {
         return 1;
     }
 
-    SharedMemory sharedMemory(memorySize, blockSize);
+    // Путь к файлу хранилища в аргументах включает постоянный режим
+    SharedMemory* sharedMemory = argc > 1
+        ? new SharedMemory(memorySize, blockSize, argv[1])
+        : new SharedMemory(memorySize, blockSize);
 
     std::vector<HANDLE> readers;
     std::vector<HANDLE> writers;
 
     for (int i = 0; i < readersCount; ++i) {
-        auto params = new std::tuple<SharedMemory*, int, HANDLE>(&sharedMemory, i + 1, coutMutex);
+        auto params = new std::tuple<SharedMemory*, int, HANDLE>(sharedMemory, i + 1, coutMutex);
         HANDLE reader = CreateThread(NULL, 0, readerTask, params, 0, NULL);
         readers.push_back(reader);
     }
 
     for (int i = 0; i < writersCount; ++i) {
-        auto params = new std::tuple<SharedMemory*, int, HANDLE>(&sharedMemory, i + 1, coutMutex);
+        auto params = new std::tuple<SharedMemory*, int, HANDLE>(sharedMemory, i + 1, coutMutex);
         HANDLE writer = CreateThread(NULL, 0, writerTask, params, 0, NULL);
         writers.push_back(writer);
     }
 
+    auto batchWriterParams = new std::tuple<SharedMemory*, int, HANDLE>(sharedMemory, writersCount + 1, coutMutex);
+    writers.push_back(CreateThread(NULL, 0, batchWriterTask, batchWriterParams, 0, NULL));
+
+    auto batchReaderParams = new std::tuple<SharedMemory*, int, HANDLE>(sharedMemory, readersCount + 1, coutMutex);
+    readers.push_back(CreateThread(NULL, 0, batchReaderTask, batchReaderParams, 0, NULL));
+
     for (HANDLE reader : readers) {
         WaitForSingleObject(reader, INFINITE);
         CloseHandle(reader);
@@ -175,7 +928,8 @@ int main() {
 
     CloseHandle(coutMutex);
 
-    sharedMemory.printStatistics();
+    sharedMemory->printStatistics();
+    delete sharedMemory;
 
     return 0;
 }